@@ -8,7 +8,14 @@ typedef enum {
     ISSUE_JOB,
     SET_CONCURRENCY,
     STOP,
-    POLL
+    POLL,
+    STATUS,
+    ATTACH_RING
 } Command;
 
+/* Name of the unix domain socket the server listens to (besides TCP), given its port. It is placed in
+   $XDG_RUNTIME_DIR, or in LOCAL_SOCKET_DIR (given the user's ID) if that is not set */
+#define LOCAL_SOCKET_NAME "jobExecutorServer.%u.sock"
+#define LOCAL_SOCKET_DIR "/tmp/jobExecutorServer-%u"
+
 #endif
\ No newline at end of file
@@ -1,19 +1,39 @@
 #ifndef JOBS_H
 #define JOBS_H
 
+#include <pthread.h>
+
 #include "commands.h"
+#include "topology.h"
 #include "utils.h"
 
+// Client connection shared by several jobs (jobs submitted through a shared-memory ring)
+typedef struct {
+    int sock;
+    int codecs;             // compression codecs negotiated with the client (0 if none)
+    int refs;               // jobs yet to be answered, plus one while the ring is still attached
+    pthread_mutex_t mtx;    // Recursive. Keeps responses of different jobs from interleaving, protects refs
+} SharedConn;
+
 typedef struct {
     char *id;
     char *full_command;
     int argc; // Number of arguments in full command
     Command command;
     int sock; // client's socket to send data back to
+    Placement placement; // CPU/NUMA hint given at submission
+    int codecs; // compression codecs negotiated with the client (0 if none)
+    /* Connection shared with other jobs, or NULL if the job owns sock. When set, sock and codecs are copies
+       of conn->sock and conn->codecs, taken at submission (neither changes while the job holds a ref) */
+    SharedConn *conn;
+    // Whether the client has been told the job was submitted. Guarded by MUTEX.mtx_acked, signalled through
+    // CONDVAR.job_acked
+    bool acked;
 } Job;
 
-// Creates and returns a job
-Job *job_create(char *id, char *full_command, int argc, Command command, int sock);
+// Creates and returns a job. If placement is NULL, the job has no CPU/NUMA hint
+Job *job_create(char *id, char *full_command, int argc, Command command, int sock, Placement *placement,
+                int codecs);
 
 // Destroys given job, freeing up all memory
 void job_destroy(Job *job);
@@ -0,0 +1,55 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_SLOTS 256          // Number of records the ring can hold
+#define RING_RECORD_SIZE 4096   // Max size of a single record
+
+typedef struct {
+    uint32_t len;
+    char data[RING_RECORD_SIZE];
+} RingSlot;
+
+/* Layout of the shared memory. A single producer (jobCommander) and a single consumer (the server) use it
+   without any syscall as long as the other side is awake: eventfds are only written when the other side
+   has announced that it is about to sleep */
+typedef struct {
+    _Atomic uint32_t head;              // Next slot to be written (only modified by the producer)
+    _Atomic uint32_t tail;              // Next slot to be read (only modified by the consumer)
+    _Atomic bool consumer_waiting;      // Consumer sleeps on data_efd
+    _Atomic bool producer_waiting;      // Producer sleeps on space_efd
+    RingSlot slots[RING_SLOTS];
+} RingShm;
+
+typedef struct {
+    int memfd;      // Backing memory of shm
+    int data_efd;   // Written by the producer to wake up the consumer
+    int space_efd;  // Written by the consumer to wake up the producer
+    RingShm *shm;
+} Ring;
+
+// Creates an empty ring backed by a new memfd (producer side)
+Ring *ring_create(void);
+
+/* Maps the ring described by given fds (consumer side). The fds come from an untrusted client, so memfd
+   must be sealed against resizing and the others must be non-blocking eventfds open for reading and writing.
+   Returns NULL (leaving the fds open) if that is not the case */
+Ring *ring_attach(int memfd, int data_efd, int space_efd);
+
+// Unmaps given ring, closes its fds and frees up all memory
+void ring_destroy(Ring *ring);
+
+/* Enqueues a record of len bytes, sleeping while the ring is full.
+   Returns false if peer_sock was hung up while waiting for space or the ring's eventfds failed */
+bool ring_push(Ring *ring, void *record, size_t len, int peer_sock);
+
+/* Dequeues the next record into buf (which must hold RING_RECORD_SIZE bytes) and returns its length.
+   Sleeps while the ring is empty and returns -1 once it is empty and peer_sock has been shut down,
+   or if the ring's eventfds failed */
+int ring_pop(Ring *ring, void *buf, int peer_sock);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Where worker threads are pinned (chosen at server startup)
+typedef enum {
+    PIN_NONE,   // Workers and jobs run wherever the kernel puts them
+    PIN_CORE,   // Each worker is pinned to a single core, jobs are balanced across nodes
+    PIN_NODE    // Each worker is pinned to the CPUs of a NUMA node, jobs are balanced across nodes
+} PinMode;
+
+typedef struct {
+    int id;         // Node's ID as reported by the kernel
+    cpu_set_t cpus; // CPUs belonging to this node
+    int ncpus;      // Number of CPUs in cpus
+} NumaNode;
+
+typedef struct {
+    NumaNode *nodes;
+    int num_nodes;
+    bool numa;      // False if the kernel exposes no NUMA info (a single fake node is used)
+} Topology;
+
+// Placement hint of a job: node is -1 and has_cpus is false if the job has no hint
+typedef struct {
+    int node;
+    bool has_cpus;
+    cpu_set_t cpus;
+} Placement;
+
+/* Detects the NUMA nodes of the machine and their CPUs through sysfs. Only the CPUs the process is allowed
+   to run on are kept and nodes left without any are dropped.
+   If that info is unavailable, all allowed CPUs are considered part of node 0 */
+Topology *topology_detect(void);
+
+// Destroys given topology, freeing up all memory
+void topology_destroy(Topology *topo);
+
+// Returns the index (in topo->nodes) of the node with given ID or -1 if there is no such node
+int topology_node_index(Topology *topo, int node_id);
+
+// Returns the index (in topo->nodes) of the node given CPU belongs to or -1 if CPU is unknown
+int topology_cpu_node(Topology *topo, int cpu);
+
+// Returns the index of the n-th CPU (counting from 0, wrapping around) that belongs to given set
+int cpuset_nth(cpu_set_t *set, int n);
+
+/* Parses a CPU list of the form "0-3,8,10-11" into given set.
+   Returns false if the list is malformed or empty */
+bool parse_cpulist(const char *str, cpu_set_t *set);
+
+// Writes given set in CPU list form ("0-3,8") into buf, truncating if needed
+void format_cpulist(cpu_set_t *set, char *buf, size_t size);
+
+/* Returns true only if given placement can be satisfied by the machine,
+   i.e. its node exists and all of its CPUs belong to some node */
+bool placement_valid(Topology *topo, Placement *placement);
+
+/* Applies given placement to the calling process: CPU affinity is set to the hinted CPUs
+   (or the node's CPUs if only a node is hinted) and memory is bound to the hinted node.
+   Meant to be called by a job's process right before execvp() */
+void placement_apply(Topology *topo, Placement *placement);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Compression codecs a jobCommander can ask for (advertised as a bitmask of CODEC_MASK()s)
+typedef enum {
+    CODEC_NONE = 0, // Chunk is sent as-is
+    CODEC_ZLIB = 1  // Chunk is compressed with zlib's deflate
+} Codec;
+
+#define CODEC_MASK(codec) (1 << (codec))
+
+#define CHUNK_SIZE (64 * 1024)  // Max number of raw bytes carried by a single frame
+#define MIN_COMPRESS_SIZE 512   // Chunks smaller than this are never compressed
+
+// Counters describing the data that went through transport_send()
+typedef struct {
+    unsigned long raw_bytes;        // Bytes given to be sent
+    unsigned long wire_bytes;       // Bytes actually written (frame headers included)
+    unsigned long compressed_chunks;
+    unsigned long stored_chunks;    // Chunks sent uncompressed (small or incompressible)
+    double cpu_seconds;             // CPU time spent compressing
+} TransportStats;
+
+// Returns a (dynamically allocated) scratch buffer big enough for any frame transport_send() compresses
+char *transport_frame_create(void);
+
+/* Sends count bytes of buf to fd. If codecs is 0, the peer did not negotiate compression and the bytes
+   are written as-is. Otherwise they are split in frames of at most CHUNK_SIZE bytes, each compressed with
+   the best codec in codecs unless it is too small or turns out incompressible.
+   Frame format: codec (uint8) + raw_len (uint32) + payload_len (uint32) + payload.
+   frame is a buffer from transport_frame_create() that callers sending lots of data should reuse. If it is
+   NULL, one is allocated only when a chunk actually gets compressed.
+   If stats is not NULL, the transfer is accounted in it.
+   Returns false if fd's peer has gone away (EPIPE, so SIGPIPE must be ignored, or ECONNRESET) */
+bool transport_send(int fd, int codecs, void *buf, size_t count, char *frame, TransportStats *stats);
+
+/* Reads frames from fd until EOF, decoding them one by one and writing the original bytes to out_fd.
+   Memory use is bounded by the frame size, no matter how much data is received */
+void transport_recv(int fd, int out_fd);
+
+// Adds the counters of src to dst
+void transport_stats_merge(TransportStats *dst, TransportStats *src);
+
+#endif
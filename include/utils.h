@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 // Prints given message using perror() and calls exit() with code EXIT_FAILURE
@@ -16,12 +17,26 @@ char *duplicate_str(char *str);
 // Returns true only if given string is solely composed of digits from 0-9
 bool only_numeric_digits(char *str);
 
-// A modified version of the read() syscall which reads all desired bytes
-void fullread(int fd, void *buf, size_t count);
+/* A modified version of the read() syscall which reads all desired bytes.
+   Returns false if EOF is reached (or a socket's peer resets the connection) before all of them are read */
+bool fullread(int fd, void *buf, size_t count);
 
 /* A modified version of the write() syscall which writes all desired bytes.
    This version is only useful when is is needed to write very large number of
    data and it is ok for the writing to happen in multiple write() calls */
 void fullwrite(int fd, void *buf, size_t count);
 
+// Passes given file descriptors to the peer of given unix domain socket (along with a single dummy byte)
+void send_fds(int sock, int *fds, int count);
+
+/* Receives exactly count file descriptors sent through send_fds() into fds.
+   Returns false (having closed any descriptors received) if the peer did not send as many */
+bool recv_fds(int sock, int *fds, int count);
+
+/* Writes the path of the local socket of the server listening to given port into buf (see commands.h).
+   If create is true, the per-user directory is created when missing. On success, NULL is returned.
+   Otherwise, the reason is returned: the path does not fit, or its directory is missing or could be
+   tampered with by other users (not owned by us or accessible by others) */
+char *local_socket_path(uint16_t port, bool create, char *buf, size_t size);
+
 #endif
\ No newline at end of file
@@ -1,13 +1,17 @@
 #include <netdb.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "commands.h"
+#include "ring.h"
+#include "transport.h"
 #include "utils.h"
 
 // Returns provided command or NO_CMD if any type of args-error has occured
@@ -22,6 +26,10 @@ static Command parse_args(int argc, char **argv) {
             command = EXIT;
         else if (strcmp(argv[3], "poll") == 0)
             command = POLL;
+        else if (strcmp(argv[3], "status") == 0)
+            command = STATUS;
+        else if (strcmp(argv[3], "issueJobs") == 0)
+            command = ATTACH_RING;
         break;
     case 5:
         if (strcmp(argv[3], "issueJob") == 0)
@@ -30,6 +38,8 @@ static Command parse_args(int argc, char **argv) {
             command = SET_CONCURRENCY;
         else if (strcmp(argv[3], "stop") == 0)
             command = STOP;
+        else if (strcmp(argv[3], "issueJobs") == 0 && strcmp(argv[4], "--compress") == 0)
+            command = ATTACH_RING;
         break;
     default:
         if (strcmp(argv[3], "issueJob") == 0)
@@ -39,22 +49,37 @@ static Command parse_args(int argc, char **argv) {
     return command;
 }
 
-// Constructs and returns the message that will be sent to the server
-static char *msg_to_server(Command command, int ac, char **args, int *msglen) {
+/* Constructs and returns the message that will be sent to the server.
+   Returns NULL and points *error to the reason if given args are invalid */
+static char *msg_to_server(Command command, int ac, char **args, int *msglen, int *codecs, char **error) {
     char *msg;
-    int new_concurrency, len, bytes_to_read, total_bytes;
+    int new_concurrency, len, bytes_to_read, total_bytes, node = -1, cpus_len = 0;
+    char *cpus = NULL, *offset;
     switch (command) {
     // Format: command (int)
     case EXIT:
     case POLL:
+    case STATUS:
         msg = malloc(sizeof(Command) * sizeof(*msg));
         if (msg == NULL) perrorexit("malloc");
         memcpy(msg, &command, sizeof(Command));
         *msglen = sizeof(Command);
         break;
+    // Format: command (int) + codecs (int)
+    case ATTACH_RING:
+        if (ac == 1) *codecs = CODEC_MASK(CODEC_ZLIB); // --compress
+        msg = malloc((sizeof(Command) + sizeof(int)) * sizeof(*msg));
+        if (msg == NULL) perrorexit("malloc");
+        memcpy(msg, &command, sizeof(Command));
+        memcpy(msg + sizeof(Command), codecs, sizeof(int));
+        *msglen = sizeof(Command) + sizeof(int);
+        break;
     // Format: command (int) + new_concurrency (int)
     case SET_CONCURRENCY:
-        if ((new_concurrency = atoi(args[0])) == 0) errorexit("Concurrency must be a positive number");
+        if ((new_concurrency = atoi(args[0])) == 0) {
+            *error = "Concurrency must be a positive number";
+            return NULL;
+        }
         msg = malloc((sizeof(Command) + sizeof(int)) * sizeof(*msg));
         if (msg == NULL) perrorexit("malloc");
         memcpy(msg, &command, sizeof(Command));
@@ -71,24 +96,52 @@ static char *msg_to_server(Command command, int ac, char **args, int *msglen) {
         memcpy(msg + sizeof(Command) + sizeof(int), args[0], len);
         *msglen = sizeof(Command) + sizeof(int) + len;
         break;
-    // Format: command (int) + num_of_args (int) + bytes_to_read (int) + command (string)
+    /* Format: command (int) + codecs (int) + num_of_args (int) + bytes_to_read (int) + command (string) +
+               node (int, -1 if none) + cpus_len (int, 0 if none) + cpus (string).
+       codecs comes first, so that the server can frame every response (rejections included) accordingly */
     case ISSUE_JOB:
+        // Placement/transport options precede the job itself
+        while (ac > 0 && strncmp(args[0], "--", 2) == 0) {
+            if (strncmp(args[0], "--node=", 7) == 0 && args[0][7] != '\0' && only_numeric_digits(args[0] + 7))
+                node = atoi(args[0] + 7);
+            else if (strncmp(args[0], "--cpus=", 7) == 0 && args[0][7] != '\0')
+                cpus = args[0] + 7;
+            else if (strcmp(args[0], "--compress") == 0)
+                *codecs = CODEC_MASK(CODEC_ZLIB);
+            else {
+                *error = "Invalid option (expected --node=N, --cpus=LIST or --compress)";
+                return NULL;
+            }
+            ac--;
+            args++;
+        }
+        if (ac == 0) {
+            *error = "No job given";
+            return NULL;
+        }
+        if (cpus != NULL) cpus_len = strlen(cpus) + 1;
         bytes_to_read = 1; // For the '\0' at the end
         for (int i = 0; i < ac; i++)
             bytes_to_read += strlen(args[i]);
         // Add nessecary spaces between the command's arguments
         bytes_to_read = bytes_to_read + ac - 1;
-        total_bytes = sizeof(Command) + 2 * sizeof(int) + bytes_to_read;
+        total_bytes = sizeof(Command) + 5 * sizeof(int) + bytes_to_read + cpus_len;
         msg = malloc(total_bytes * sizeof(*msg));
         if (msg == NULL) perrorexit("malloc");
         memcpy(msg, &command, sizeof(Command));
-        memcpy(msg + sizeof(Command), &ac, sizeof(int));
-        memcpy(msg + sizeof(Command) + sizeof(int), &bytes_to_read, sizeof(int));
-        memset(msg + sizeof(Command) + 2 * sizeof(int), '\0', 1);
+        memcpy(msg + sizeof(Command), codecs, sizeof(int));
+        offset = msg + sizeof(Command) + sizeof(int);
+        memcpy(offset, &ac, sizeof(int));
+        memcpy(offset + sizeof(int), &bytes_to_read, sizeof(int));
+        memset(offset + 2 * sizeof(int), '\0', 1);
         for (int i = 0; i < ac; i++) {
-            if (i >= 1) strcat(msg + sizeof(Command) + 2 * sizeof(int), " ");
-            strcat(msg + sizeof(Command) + 2 * sizeof(int), args[i]);
+            if (i >= 1) strcat(offset + 2 * sizeof(int), " ");
+            strcat(offset + 2 * sizeof(int), args[i]);
         }
+        offset += 2 * sizeof(int) + bytes_to_read;
+        memcpy(offset, &node, sizeof(int));
+        memcpy(offset + sizeof(int), &cpus_len, sizeof(int));
+        if (cpus != NULL) memcpy(offset + 2 * sizeof(int), cpus, cpus_len);
         *msglen = total_bytes;
         break;
     default:
@@ -98,17 +151,29 @@ static char *msg_to_server(Command command, int ac, char **args, int *msglen) {
     return msg;
 }
 
-int main(int argc, char **argv) {
-    // Assure that program arguments are valid and store the given command
-    Command command = parse_args(argc, argv);
-    if (command == NO_CMD) {
-        fprintf(stderr, "Usage: %s [serverName] [portNum] [jobCommanderInputCommand]\n", argv[0]);
-        exit(EXIT_FAILURE);
+/* Connects to the server through its unix domain socket. Returns the socket or -1 if the server
+   does not listen to one (e.g. it runs on another host, as another user or is an older version) */
+static int connect_local(uint16_t port) {
+    struct sockaddr_un server;
+    memset(&server, 0, sizeof(server));
+    server.sun_family = AF_UNIX;
+    if (local_socket_path(port, false, server.sun_path, sizeof(server.sun_path)) != NULL) return -1;
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd == -1) perrorexit("socket");
+    if (connect(sockfd, (struct sockaddr *)&server, sizeof(server)) == -1) {
+        if (close(sockfd) == -1) perrorexit("close");
+        return -1;
     }
-    char *server_name = argv[1];
-    uint16_t port = atoi(argv[2]);
+    // Jobs (and ring fds) are only handed to a server run by the same user
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) perrorexit("getsockopt");
+    if (cred.uid != getuid()) errorexit("Local socket is served by another user, refusing to use it");
+    return sockfd;
+}
 
-    // Init socket
+// Connects to the server through TCP and returns the socket
+static int connect_tcp(char *server_name, uint16_t port) {
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd == -1) perrorexit("socket");
     struct hostent *rem = gethostbyname(server_name);
@@ -117,25 +182,144 @@ int main(int argc, char **argv) {
     server.sin_family = AF_INET;
     memcpy(&(server.sin_addr), rem->h_addr, rem->h_length);
     server.sin_port = htons(port);
-    // Initiate connection
     if (connect(sockfd, (struct sockaddr *)&server, sizeof(server)) == -1) perrorexit("connect");
-    printf("Connecting to %s port %d\n", server_name, port);
-    
-    int msglen;
-    char *msg = msg_to_server(command, argc - 4, argv + 4, &msglen);
-    // Write message to server
-    fullwrite(sockfd, msg, msglen);
-    if (shutdown(sockfd, SHUT_WR) == -1) perrorexit("shutdown");
-    free(msg);
+    return sockfd;
+}
 
+// Prints the server's response, decoding it if compression was negotiated
+static void read_response(int sockfd, int codecs) {
     char buf[1024]; // General purpose buffer
     int n;
-    // Read server's response
+    if (codecs != 0) { // Response is framed, decode it as it arrives
+        fflush(stdout);
+        transport_recv(sockfd, STDOUT_FILENO);
+        return;
+    }
     while ((n = read(sockfd, buf, sizeof(buf) - 1)) > 0) {
         buf[n] = '\0';
         printf("%s", buf);
+        fflush(stdout); // Responses must show up as they arrive, even when stdout is not a terminal
     }
     if (n == -1) perrorexit("read");
+}
+
+typedef struct {
+    int sockfd;
+    int codecs;
+} ResponseArgs;
+
+// Implementation of the thread printing responses while jobs are still being enqueued into the ring
+static void *thread_response(void *arg) {
+    ResponseArgs *args = arg;
+    read_response(args->sockfd, args->codecs);
+    return NULL;
+}
+
+// Prints given (tokenized) job line to stream, one space before each arg
+static void print_args(FILE *stream, int ac, char **args) {
+    for (int i = 0; i < ac; i++)
+        fprintf(stream, " %s", args[i]);
+    fprintf(stream, "\n");
+}
+
+// Offset of a ring record within an ISSUE_JOB message
+#define RECORD_OFFSET (sizeof(Command) + sizeof(int))
+
+/* Enqueues the jobs read from stdin (one per line, in the form of issueJob's args) into a shared-memory
+   ring handed to the server, so that no syscall is needed per job. Responses are printed as they come */
+static void submit_ring(int sockfd, int codecs) {
+    Ring *ring = ring_create();
+    int fds[3] = {ring->memfd, ring->data_efd, ring->space_efd};
+    send_fds(sockfd, fds, 3);
+
+    pthread_t responder;
+    ResponseArgs response_args = {.sockfd = sockfd, .codecs = codecs};
+    if (pthread_create(&responder, NULL, thread_response, &response_args) != 0) errorexit("pthread_create");
+
+    char *line = NULL, *the_rest, *token, *msg, *error;
+    size_t size = 0;
+    int ac, capacity = 16, msglen, line_codecs;
+    char **args = malloc(capacity * sizeof(*args));
+    if (args == NULL) perrorexit("malloc");
+    while (getline(&line, &size, stdin) != -1) {
+        ac = 0;
+        the_rest = line;
+        while ((token = strtok_r(the_rest, " \t\n", &the_rest)) != NULL) {
+            if (ac == capacity) {
+                capacity *= 2;
+                if ((args = realloc(args, capacity * sizeof(*args))) == NULL) perrorexit("realloc");
+            }
+            args[ac++] = token;
+        }
+        if (ac == 0) continue; // Empty line
+        // Compression is negotiated once for the whole connection (issueJobs --compress), not per job
+        bool per_job_compress = false;
+        for (int i = 0; i < ac && strncmp(args[i], "--", 2) == 0; i++)
+            if (strcmp(args[i], "--compress") == 0) per_job_compress = true;
+        if (per_job_compress) {
+            fprintf(stderr, "--compress applies to issueJobs as a whole, job skipped:");
+            print_args(stderr, ac, args);
+            continue;
+        }
+        line_codecs = 0;
+        // A bad line must not end the stream, which the server is already consuming
+        if ((msg = msg_to_server(ISSUE_JOB, ac, args, &msglen, &line_codecs, &error)) == NULL) {
+            fprintf(stderr, "%s, job skipped:", error);
+            print_args(stderr, ac, args);
+            continue;
+        }
+        // Records are ISSUE_JOB messages without the command and codecs (negotiated by ATTACH_RING)
+        if (msglen - RECORD_OFFSET > RING_RECORD_SIZE) {
+            fprintf(stderr, "Job too long for the ring, skipped:");
+            print_args(stderr, ac, args);
+        } else if (!ring_push(ring, msg + RECORD_OFFSET, msglen - RECORD_OFFSET, sockfd)) {
+            free(msg);
+            break; // Server hung up
+        }
+        free(msg);
+    }
+    free(line);
+    free(args);
+    // No more jobs: the server answers the remaining ones and then hangs up
+    if (shutdown(sockfd, SHUT_WR) == -1) perrorexit("shutdown");
+    if (pthread_join(responder, NULL) != 0) errorexit("pthread_join");
+    ring_destroy(ring);
+}
+
+int main(int argc, char **argv) {
+    // Assure that program arguments are valid and store the given command
+    Command command = parse_args(argc, argv);
+    if (command == NO_CMD) {
+        fprintf(stderr, "Usage: %s [serverName] [portNum] [jobCommanderInputCommand]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    char *server_name = argv[1];
+    uint16_t port = atoi(argv[2]);
+
+    // Init socket. The server is reached through its unix domain socket when it runs on this host
+    int sockfd = -1;
+    if (strcmp(server_name, "localhost") == 0 && (sockfd = connect_local(port)) != -1) {
+        printf("Connecting to %s port %d (local socket)\n", server_name, port);
+    } else {
+        if (command == ATTACH_RING) errorexit("issueJobs needs a server listening to a local socket (localhost)");
+        sockfd = connect_tcp(server_name, port);
+        printf("Connecting to %s port %d\n", server_name, port);
+    }
+    
+    int msglen, codecs = 0;
+    char *error;
+    char *msg = msg_to_server(command, argc - 4, argv + 4, &msglen, &codecs, &error);
+    if (msg == NULL) errorexit(error);
+    // Write message to server
+    fullwrite(sockfd, msg, msglen);
+    free(msg);
+    if (command == ATTACH_RING) {
+        fflush(stdout); // Responses are printed by another thread
+        submit_ring(sockfd, codecs);
+    } else {
+        if (shutdown(sockfd, SHUT_WR) == -1) perrorexit("shutdown");
+        read_response(sockfd, codecs);
+    }
 
     if (close(sockfd) == -1) perrorexit("close");
     
@@ -2,6 +2,7 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
@@ -10,11 +11,15 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "commands.h"
 #include "queue.h"
+#include "ring.h"
+#include "topology.h"
+#include "transport.h"
 #include "utils.h"
 
 static struct {
@@ -27,6 +32,16 @@ static struct {
     int thread_pool_size;       // Num of worker threads
     int concurrency;            // concurrency level
     int active_workers;         // num of active workers (at most thread_pool_size)
+
+    Topology *topo;             // Machine's NUMA nodes and their CPUs
+    PinMode pin_mode;           // How worker threads (and unhinted jobs) are placed
+    int *node_running;          // num of running jobs per node (indexed like topo->nodes)
+    int *node_dispatched;       // num of jobs ever dispatched per node
+    int unplaced_running;       // num of running jobs not tied to any node
+
+    TransportStats output_stats; // Stats about the job outputs sent to clients
+    
+    char local_path[sizeof(((struct sockaddr_un *)0)->sun_path)]; // Path of the unix domain socket
     
     bool exit_program;          // Boolean var determining program status
 } DATA;
@@ -36,39 +51,297 @@ static struct {
     pthread_mutex_t mtx_concurrency;
     pthread_mutex_t mtx_active_workers;
     pthread_mutex_t mtx_jobid;
+    pthread_mutex_t mtx_nodes;
+    pthread_mutex_t mtx_stats;
+    pthread_mutex_t mtx_acked;
 } MUTEX;
 
 static struct {
     pthread_cond_t wakeup_job;
     pthread_cond_t buf_not_full;
+    pthread_cond_t job_acked;
 } CONDVAR;
 
-/* Stores program's args into given variables (port, bufsize, thread_pool_size).
+// Returns the pin mode named by given string or -1 if there is no such mode
+static int parse_pin_mode(char *str) {
+    if (strcmp(str, "none") == 0) return PIN_NONE;
+    if (strcmp(str, "core") == 0) return PIN_CORE;
+    if (strcmp(str, "node") == 0) return PIN_NODE;
+    return -1;
+}
+
+/* Stores program's args into given variables (port, bufsize, thread_pool_size, pin_mode).
    Terminates program's execution if an args error is caught */
-static void parse_args(int argc, char **argv, uint16_t *port, int *bufsize, int *thread_pool_size) {
-    if (argc == 4 &&
+static void parse_args(int argc, char **argv, uint16_t *port, int *bufsize, int *thread_pool_size,
+                       PinMode *pin_mode) {
+    int mode = PIN_NONE;
+    if ((argc == 4 || (argc == 5 && (mode = parse_pin_mode(argv[4])) != -1)) &&
         only_numeric_digits(argv[1]) && (*port = atoi(argv[1])) > 0 &&
         only_numeric_digits(argv[2]) && (*bufsize = atoi(argv[2])) > 0 &&
         only_numeric_digits(argv[3]) && (*thread_pool_size = atoi(argv[3])) > 0)
     {
+        *pin_mode = mode;
         return; // Success
     }
-    fprintf(stderr, "Usage: %s [portnum] [bufferSize] [threadPoolSize]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [portnum] [bufferSize] [threadPoolSize] [none|core|node]\n", argv[0]);
     exit(EXIT_FAILURE);
 }
 
+/* Decides on which node given job will run and accounts for it. Jobs hinted to a node (or CPUs)
+   run there, unhinted ones go to the least utilized node unless pinning is disabled.
+   Returns the node's index in DATA.topo->nodes or -1 if the job is not tied to any node */
+static int place_job(Job *job) {
+    int index = -1;
+    pthread_mutex_lock(&MUTEX.mtx_nodes);
+    if (job->placement.node != -1) {
+        index = topology_node_index(DATA.topo, job->placement.node);
+    } else if (job->placement.has_cpus) {
+        index = topology_cpu_node(DATA.topo, cpuset_nth(&job->placement.cpus, 0));
+    } else if (DATA.pin_mode != PIN_NONE) {
+        index = 0;
+        for (int i = 1; i < DATA.topo->num_nodes; i++) // Compare running jobs per CPU
+            if (DATA.node_running[i] * DATA.topo->nodes[index].ncpus <
+                DATA.node_running[index] * DATA.topo->nodes[i].ncpus)
+                index = i;
+        job->placement.node = DATA.topo->nodes[index].id;
+    }
+    if (index != -1) {
+        DATA.node_running[index]++;
+        DATA.node_dispatched[index]++;
+    } else {
+        DATA.unplaced_running++;
+    }
+    pthread_mutex_unlock(&MUTEX.mtx_nodes);
+    return index;
+}
+
+// Reverts the accounting done by place_job() once the job has finished
+static void unplace_job(int index) {
+    pthread_mutex_lock(&MUTEX.mtx_nodes);
+    if (index != -1) DATA.node_running[index]--;
+    else DATA.unplaced_running--;
+    pthread_mutex_unlock(&MUTEX.mtx_nodes);
+}
+
+// Locks the connection of given job if it is shared with other jobs, so that responses do not interleave
+static void lock_job_conn(Job *job) {
+    if (job->conn != NULL) pthread_mutex_lock(&job->conn->mtx);
+}
+
+static void unlock_job_conn(Job *job) {
+    if (job->conn != NULL) pthread_mutex_unlock(&job->conn->mtx);
+}
+
+// Sends given data to the client that issued given job, compressing it if the client asked so
+static void send_to_job(Job *job, void *buf, size_t count) {
+    lock_job_conn(job);
+    transport_send(job->sock, job->codecs, buf, count, NULL, NULL);
+    unlock_job_conn(job);
+}
+
+/* Sends given response to a client. A client that has gone away is simply dropped: whatever is left of
+   the exchange goes nowhere, instead of taking the server down */
+static void reply(int sock, void *buf, size_t count) {
+    transport_send(sock, 0, buf, count, NULL, NULL);
+}
+
+// "Sends" EOF to a client, unless it has already gone away
+static void end_reply(int sock) {
+    if (shutdown(sock, SHUT_WR) == -1 && errno != ENOTCONN) perrorexit("shutdown");
+}
+
+// Drops a reference to given shared connection. The last one "sends" EOF to the client
+static void conn_release(SharedConn *conn) {
+    pthread_mutex_lock(&conn->mtx);
+    bool last = --conn->refs == 0;
+    pthread_mutex_unlock(&conn->mtx);
+    if (!last) return;
+    end_reply(conn->sock);
+    if (pthread_mutex_destroy(&conn->mtx) != 0) errorexit("pthread_mutex_destroy");
+    free(conn);
+}
+
+// "Sends" EOF to the client that issued given job, unless other jobs still use its connection
+static void finish_job_conn(Job *job) {
+    if (job->conn != NULL) conn_release(job->conn);
+    else end_reply(job->sock);
+}
+
+// Drops the connection of a client that disconnected in the middle of its message, along with the calling thread
+static void drop_client(int sock) {
+    if (close(sock) == -1) perrorexit("close");
+    pthread_exit(NULL);
+}
+
+// Reads data for read_issue_job(). Returns false if there is not enough data
+typedef bool (*Reader)(void *src, void *buf, size_t count);
+
+// Reader of data coming from a socket (src points to the socket)
+static bool sock_reader(void *src, void *buf, size_t count) {
+    return fullread(*(int *)src, buf, count);
+}
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t pos;
+} RecordCursor;
+
+// Reader of data coming from a ring record (src points to a RecordCursor)
+static bool record_reader(void *src, void *buf, size_t count) {
+    RecordCursor *cursor = src;
+    if (count > cursor->len - cursor->pos) return false;
+    memcpy(buf, cursor->data + cursor->pos, count);
+    cursor->pos += count;
+    return true;
+}
+
+// Reason returned by read_issue_job() when the message ends early (i.e. a socket's peer disconnected)
+static char TRUNCATED[] = "TRUNCATED REQUEST";
+
+/* Reads the body of an ISSUE_JOB message (everything after the command and codecs) through given reader.
+   On success, NULL is returned and *msg holds the (dynamically allocated) command.
+   Otherwise, the reason for which the job is rejected is returned */
+static char *read_issue_job(Reader reader, void *src, int *argc, char **msg, Placement *placement) {
+    int bytes_to_read, len;
+    char cpus[1024];
+    if (!reader(src, argc, sizeof(int)) || !reader(src, &bytes_to_read, sizeof(int))) return TRUNCATED;
+    if (bytes_to_read <= 0) return "INVALID REQUEST";
+    if ((*msg = malloc(bytes_to_read * sizeof(**msg))) == NULL) perrorexit("malloc");
+    if (!reader(src, *msg, bytes_to_read) || !reader(src, &placement->node, sizeof(int)) ||
+        !reader(src, &len, sizeof(int)))
+    {
+        free(*msg);
+        return TRUNCATED;
+    }
+    if ((*msg)[bytes_to_read - 1] != '\0' || len < 0 || len > (int)sizeof(cpus)) {
+        free(*msg);
+        return "INVALID REQUEST";
+    }
+    if (!reader(src, cpus, len)) {
+        free(*msg);
+        return TRUNCATED;
+    }
+    placement->has_cpus = len > 0;
+    if ((placement->has_cpus && (cpus[len - 1] != '\0' || !parse_cpulist(cpus, &placement->cpus))) ||
+        !placement_valid(DATA.topo, placement))
+    {
+        free(*msg);
+        return "INVALID PLACEMENT HINT";
+    }
+    return NULL;
+}
+
+/* Waits until the submission of given job has been acknowledged to its client. Nothing else may be sent
+   to the client (or the job destroyed) before that */
+static void wait_job_acked(Job *job) {
+    pthread_mutex_lock(&MUTEX.mtx_acked);
+    while (!job->acked)
+        pthread_cond_wait(&CONDVAR.job_acked, &MUTEX.mtx_acked);
+    pthread_mutex_unlock(&MUTEX.mtx_acked);
+}
+
+/* Creates a job out of given fields, adds it to buf and acknowledges its submission to the client.
+   Returns false if the server was terminated before the job could be added */
+static bool submit_job(char *msg, int argc, int sock, Placement *placement, int codecs, SharedConn *conn) {
+    char buf[64];
+    pthread_mutex_lock(&MUTEX.mtx_jobid);
+    sprintf(buf, "job_%d", DATA.jobid_counter++);
+    pthread_mutex_unlock(&MUTEX.mtx_jobid);
+    Job *job = job_create(buf, msg, argc, ISSUE_JOB, sock, placement, codecs);
+    job->conn = conn;
+    // Add the job to buf
+    pthread_mutex_lock(&MUTEX.mtx_buf);
+    while (queue_size(DATA.buf) == DATA.capacity) { // While buf is full
+        pthread_cond_wait(&CONDVAR.buf_not_full, &MUTEX.mtx_buf);
+        if (DATA.exit_program) {
+            pthread_mutex_unlock(&MUTEX.mtx_buf);
+            send_to_job(job, "SERVER TERMINATED BEFORE EXECUTION\n", 35);
+            finish_job_conn(job);
+            job_destroy(job);
+            return false;
+        }
+    }
+    queue_add(DATA.buf, job);
+    pthread_mutex_unlock(&MUTEX.mtx_buf);
+    // Perhaps a job should wakeup (cond is checked in worker-thread)
+    pthread_cond_signal(&CONDVAR.wakeup_job);
+    /* Write response back to jobCommander. The job may already be running, but whoever takes it out
+       of buf waits for job->acked, so its output (or removal) cannot precede this response */
+    lock_job_conn(job);
+    send_to_job(job, "JOB <", 5);
+    send_to_job(job, job->id, strlen(job->id));
+    send_to_job(job, ", ", 2);
+    send_to_job(job, job->full_command, strlen(job->full_command));
+    send_to_job(job, "> SUBMITTED\n", 12);
+    unlock_job_conn(job);
+    pthread_mutex_lock(&MUTEX.mtx_acked);
+    job->acked = true;
+    pthread_cond_broadcast(&CONDVAR.job_acked);
+    pthread_mutex_unlock(&MUTEX.mtx_acked);
+    return true;
+}
+
+// Pins the calling worker thread according to DATA.pin_mode. index is the worker's index in the pool
+static void pin_worker(int index) {
+    cpu_set_t cpus;
+    if (DATA.pin_mode == PIN_NONE) return;
+    if (DATA.pin_mode == PIN_NODE) {
+        cpus = DATA.topo->nodes[index % DATA.topo->num_nodes].cpus;
+    } else { // PIN_CORE: workers are spread over every CPU of every node
+        cpu_set_t all;
+        CPU_ZERO(&all);
+        for (int i = 0; i < DATA.topo->num_nodes; i++)
+            CPU_OR(&all, &all, &DATA.topo->nodes[i].cpus);
+        CPU_ZERO(&cpus);
+        CPU_SET(cpuset_nth(&all, index), &cpus);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) errorexit("pthread_setaffinity_np");
+}
+
+/* Sets up the unix domain socket local clients connect to and returns it. If that is not possible,
+   a warning is printed, DATA.local_path is left empty and -1 is returned */
+static int listen_local(uint16_t port) {
+    char *reason = local_socket_path(port, true, DATA.local_path, sizeof(DATA.local_path));
+    if (reason != NULL) {
+        DATA.local_path[0] = '\0';
+        fprintf(stderr, "Warning: local socket disabled (%s, check XDG_RUNTIME_DIR), serving TCP only\n", reason);
+        return -1;
+    }
+    int local_sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (local_sockfd == -1) perrorexit("socket");
+    struct sockaddr_un local;
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, DATA.local_path);
+    // A previous server on this port may have left its socket behind (the TCP bind guarantees it's dead)
+    if (unlink(DATA.local_path) == -1 && errno != ENOENT) perrorexit("unlink");
+    if (bind(local_sockfd, (struct sockaddr *)&local, sizeof(local)) == -1 || listen(local_sockfd, 12) == -1) {
+        fprintf(stderr, "Warning: local socket disabled (%s: %s), serving TCP only\n", DATA.local_path,
+                strerror(errno));
+        DATA.local_path[0] = '\0';
+        if (close(local_sockfd) == -1) perrorexit("close");
+        return -1;
+    }
+    return local_sockfd;
+}
+
 // Implementation of controller threads
 static void *thread_controller(void *arg) {
     int sock = *(int *)arg;
     free(arg);
 
     Command command;
-    int bytes_to_read, len, argc, old_concurrency, new_concurrency;
-    char *msg, *jobid;
+    int len, argc, old_concurrency, new_concurrency, codecs, fds[3];
+    char *msg, *jobid, *reason, *record;
+    bool ok, got_fds;
     Job *job;
+    Placement placement;
+    Ring *ring;
+    SharedConn *conn;
     char buf[1024]; // General purpose buffer
 
-    fullread(sock, &command, sizeof(Command));
+    if (!fullread(sock, &command, sizeof(Command))) drop_client(sock);
     switch (command) {
     // Format: command (int)
     case EXIT:
@@ -78,8 +351,9 @@ static void *thread_controller(void *arg) {
         QueueNode *node = DATA.buf->head, *next;
         while (node != NULL) {
             next = node->next;
-            if (write(node->job->sock, "SERVER TERMINATED BEFORE EXECUTION\n", 35) == -1) perrorexit("write");
-            if (shutdown(node->job->sock, SHUT_WR) == -1) perrorexit("shutdown");
+            wait_job_acked(node->job); // Acking does not need buf, so this cannot deadlock
+            send_to_job(node->job, "SERVER TERMINATED BEFORE EXECUTION\n", 35);
+            finish_job_conn(node->job);
             job_destroy(node->job);
             free(node);
             node = next;
@@ -91,102 +365,166 @@ static void *thread_controller(void *arg) {
         pthread_cond_broadcast(&CONDVAR.wakeup_job);
         for (int i = 0; i < DATA.thread_pool_size; i++)
             if (pthread_join(DATA.worker_threads[i], NULL) != 0) errorexit("pthread_join");
-        if (write(sock, "SERVER TERMINATED\n", 18) == -1) perrorexit("write");
-        if (shutdown(sock, SHUT_WR) == -1) perrorexit("shutdown");
+        // The socket may have been removed behind the server's back (e.g. by a tmp cleaner)
+        if (DATA.local_path[0] != '\0' && unlink(DATA.local_path) == -1 && errno != ENOENT) perrorexit("unlink");
+        reply(sock, "SERVER TERMINATED\n", 18);
+        end_reply(sock);
         // Free up memory
         free(DATA.worker_threads);
+        free(DATA.node_running);
+        free(DATA.node_dispatched);
+        topology_destroy(DATA.topo);
         if (pthread_mutex_destroy(&MUTEX.mtx_buf) != 0) errorexit("pthread_mutex_destroy");
         if (pthread_mutex_destroy(&MUTEX.mtx_jobid) != 0) errorexit("pthread_mutex_destroy");
         if (pthread_mutex_destroy(&MUTEX.mtx_active_workers) != 0) errorexit("pthread_mutex_destroy");
         if (pthread_mutex_destroy(&MUTEX.mtx_concurrency) != 0) errorexit("pthread_mutex_destroy");
+        if (pthread_mutex_destroy(&MUTEX.mtx_nodes) != 0) errorexit("pthread_mutex_destroy");
+        if (pthread_mutex_destroy(&MUTEX.mtx_stats) != 0) errorexit("pthread_mutex_destroy");
         if (pthread_cond_destroy(&CONDVAR.wakeup_job) != 0) errorexit("pthread_cond_destroy");
         if (pthread_cond_destroy(&CONDVAR.buf_not_full) != 0) errorexit("pthread_cond_destroy");
+        if (pthread_cond_destroy(&CONDVAR.job_acked) != 0) errorexit("pthread_cond_destroy");
+        if (pthread_mutex_destroy(&MUTEX.mtx_acked) != 0) errorexit("pthread_mutex_destroy");
         exit(EXIT_SUCCESS); // Terminate all threads
     case POLL:
         pthread_mutex_lock(&MUTEX.mtx_buf);
         for (QueueNode *node = DATA.buf->head; node != NULL; node = node->next) {
-            if (write(sock, "<", 1) == -1) perrorexit("write");
-            if (write(sock, node->job->id, strlen(node->job->id)) == -1) perrorexit("write");
-            if (write(sock, ", ", 2) == -1) perrorexit("write");
-            fullwrite(sock, node->job->full_command, strlen(node->job->full_command));
-            if (write(sock, ">\n", 2) == -1) perrorexit("write");
+            reply(sock, "<", 1);
+            reply(sock, node->job->id, strlen(node->job->id));
+            reply(sock, ", ", 2);
+            reply(sock, node->job->full_command, strlen(node->job->full_command));
+            reply(sock, ">\n", 2);
         }
         pthread_mutex_unlock(&MUTEX.mtx_buf);
-        if (shutdown(sock, SHUT_WR) == -1) perrorexit("shutdown");
+        end_reply(sock);
+        break;
+    // Format: command (int)
+    case STATUS:
+        pthread_mutex_lock(&MUTEX.mtx_nodes);
+        for (int i = 0; i < DATA.topo->num_nodes; i++) {
+            char cpulist[512];
+            NumaNode *numa_node = &DATA.topo->nodes[i];
+            format_cpulist(&numa_node->cpus, cpulist, sizeof(cpulist));
+            sprintf(buf, "NODE %d CPUS %s: RUNNING %d, DISPATCHED %d, UTILIZATION %d%%\n",
+                    numa_node->id, cpulist, DATA.node_running[i], DATA.node_dispatched[i],
+                    100 * DATA.node_running[i] / numa_node->ncpus);
+            reply(sock, buf, strlen(buf));
+        }
+        sprintf(buf, "UNPLACED: RUNNING %d\n", DATA.unplaced_running);
+        pthread_mutex_unlock(&MUTEX.mtx_nodes);
+        reply(sock, buf, strlen(buf));
+        pthread_mutex_lock(&MUTEX.mtx_stats);
+        TransportStats *stats = &DATA.output_stats;
+        sprintf(buf, "OUTPUT: RAW %lu BYTES, SENT %lu BYTES, RATIO %.2f, CHUNKS %lu COMPRESSED / %lu STORED, "
+                "COMPRESSION CPU %.3fs\n", stats->raw_bytes, stats->wire_bytes,
+                stats->wire_bytes > 0 ? (double)stats->raw_bytes / stats->wire_bytes : 1.0,
+                stats->compressed_chunks, stats->stored_chunks, stats->cpu_seconds);
+        pthread_mutex_unlock(&MUTEX.mtx_stats);
+        reply(sock, buf, strlen(buf));
+        end_reply(sock);
         break;
     // Format: command (int) + new_concurrency (int)
     case SET_CONCURRENCY:
+        if (!fullread(sock, &new_concurrency, sizeof(int))) drop_client(sock);
         pthread_mutex_lock(&MUTEX.mtx_concurrency);
         old_concurrency = DATA.concurrency;
-        fullread(sock, &DATA.concurrency, sizeof(int));
-        new_concurrency = DATA.concurrency;
+        DATA.concurrency = new_concurrency;
         pthread_mutex_unlock(&MUTEX.mtx_concurrency);
         sprintf(buf, "CONCURRENCY SET AT %d\n", new_concurrency);
-        if (write(sock, buf, strlen(buf)) == -1) perrorexit("write");
-        if (shutdown(sock, SHUT_WR) == -1) perrorexit("shutdown");
+        reply(sock, buf, strlen(buf));
+        end_reply(sock);
         // Wake up relative number of workers
         for (int i = old_concurrency; i <= new_concurrency && i <= DATA.thread_pool_size; i++)
             pthread_cond_signal(&CONDVAR.wakeup_job);
         break;
     // Format: command (int) + len (int) + jobID (string)
     case STOP:
-        fullread(sock, &len, sizeof(int));
+        if (!fullread(sock, &len, sizeof(int)) || len <= 0) drop_client(sock);
         if ((jobid = malloc(len * sizeof(*jobid))) == NULL) perrorexit("malloc");
-        fullread(sock, jobid, len);
+        if (!fullread(sock, jobid, len)) {
+            free(jobid);
+            drop_client(sock);
+        }
         // (Try to) remove job with given jobID
         pthread_mutex_lock(&MUTEX.mtx_buf);
         job = queue_remove(DATA.buf, jobid);
         pthread_mutex_unlock(&MUTEX.mtx_buf);
         // Write response
-        if (write(sock, "JOB ", 4) == -1) perrorexit("write");
-        if (write(sock, jobid, len - 1) == -1) perrorexit("write");
+        reply(sock, "JOB ", 4);
+        reply(sock, jobid, len - 1);
         free(jobid);
         if (job != NULL) { // Job was present in buf
-            if (write(sock, " REMOVED\n", 9) == -1) perrorexit("write");
+            reply(sock, " REMOVED\n", 9);
             // Wakeup another job
             pthread_cond_signal(&CONDVAR.buf_not_full);
+            wait_job_acked(job);
             // "Send" EOF to the commander that issued this job
-            if (shutdown(job->sock, SHUT_WR) == -1) perrorexit("shutdown");
+            finish_job_conn(job);
             // Destroy this job
             job_destroy(job);
         } else {
-            if (write(sock, " NOTFOUND\n", 10) == -1) perrorexit("write");
+            reply(sock, " NOTFOUND\n", 10);
         }
-        if (shutdown(sock, SHUT_WR) == -1) perrorexit("shutdown");
+        end_reply(sock);
         break;
-    // Format: command (int) + num_of_args (int) + bytes_to_read (int) + command (string)
+    /* Format: command (int) + codecs (int) + num_of_args (int) + bytes_to_read (int) + command (string) +
+               node (int, -1 if none) + cpus_len (int, 0 if none) + cpus (string) */
     case ISSUE_JOB:
-        fullread(sock, &argc, sizeof(int));
-        fullread(sock, &bytes_to_read, sizeof(int));
-        if ((msg = malloc(bytes_to_read * sizeof(*msg))) == NULL) perrorexit("malloc");
-        fullread(sock, msg, bytes_to_read);
-        pthread_mutex_lock(&MUTEX.mtx_jobid);
-        sprintf(buf, "job_%d", DATA.jobid_counter++);
-        pthread_mutex_unlock(&MUTEX.mtx_jobid);
-        job = job_create(buf, msg, argc, command, sock);
+        if (!fullread(sock, &codecs, sizeof(int))) drop_client(sock);
+        if ((reason = read_issue_job(sock_reader, &sock, &argc, &msg, &placement)) != NULL) {
+            if (reason == TRUNCATED) drop_client(sock);
+            sprintf(buf, "JOB REJECTED: %s\n", reason);
+            transport_send(sock, codecs, buf, strlen(buf), NULL, NULL);
+            end_reply(sock);
+            break;
+        }
+        ok = submit_job(msg, argc, sock, &placement, codecs, NULL);
         free(msg);
-        // Add the job to buf
-        pthread_mutex_lock(&MUTEX.mtx_buf);
-        while (queue_size(DATA.buf) == DATA.capacity) { // While buf is full
-            pthread_cond_wait(&CONDVAR.buf_not_full, &MUTEX.mtx_buf);
-            if (DATA.exit_program) {
-                pthread_mutex_unlock(&MUTEX.mtx_buf);
-                if (write(sock, "SERVER TERMINATED BEFORE EXECUTION\n", 35) == -1) perrorexit("write");
-                if (shutdown(sock, SHUT_WR) == -1) perrorexit("shutdown");
-                job_destroy(job);
-                pthread_exit(NULL);
+        if (!ok) pthread_exit(NULL);
+        break;
+    /* Format: command (int) + codecs (int), then a single byte carrying memfd, data_efd and space_efd.
+       Afterwards, the client enqueues ISSUE_JOB messages (without the command and codecs) into the ring and
+       all responses are sent back on this connection, framed according to the codecs given here */
+    case ATTACH_RING:
+        if (!fullread(sock, &codecs, sizeof(int))) drop_client(sock);
+        got_fds = recv_fds(sock, fds, 3);
+        if ((ring = got_fds ? ring_attach(fds[0], fds[1], fds[2]) : NULL) == NULL) {
+            if (got_fds) // fds were received but do not describe a valid ring
+                for (int i = 0; i < 3; i++)
+                    if (close(fds[i]) == -1) perrorexit("close");
+            transport_send(sock, codecs, "RING REJECTED\n", 14, NULL, NULL);
+            end_reply(sock);
+            break;
+        }
+        if ((conn = malloc(sizeof(*conn))) == NULL) perrorexit("malloc");
+        conn->sock = sock;
+        conn->codecs = codecs;
+        conn->refs = 1;
+        pthread_mutexattr_t attr;
+        if (pthread_mutexattr_init(&attr) != 0) errorexit("pthread_mutexattr_init");
+        if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0) errorexit("pthread_mutexattr_settype");
+        if (pthread_mutex_init(&conn->mtx, &attr) != 0) errorexit("pthread_mutex_init");
+        if (pthread_mutexattr_destroy(&attr) != 0) errorexit("pthread_mutexattr_destroy");
+        if ((record = malloc(RING_RECORD_SIZE)) == NULL) perrorexit("malloc");
+        // Consume records until the client shuts its side of the connection down and the ring is drained
+        while ((len = ring_pop(ring, record, sock)) != -1) {
+            RecordCursor cursor = {.data = record, .len = len, .pos = 0};
+            if ((reason = read_issue_job(record_reader, &cursor, &argc, &msg, &placement)) != NULL) {
+                sprintf(buf, "JOB REJECTED: %s\n", reason);
+                pthread_mutex_lock(&conn->mtx);
+                transport_send(sock, conn->codecs, buf, strlen(buf), NULL, NULL);
+                pthread_mutex_unlock(&conn->mtx);
+                continue;
             }
+            pthread_mutex_lock(&conn->mtx);
+            conn->refs++;
+            pthread_mutex_unlock(&conn->mtx);
+            ok = submit_job(msg, argc, sock, &placement, conn->codecs, conn);
+            free(msg);
+            if (!ok) pthread_exit(NULL);
         }
-        queue_add(DATA.buf, job);
-        pthread_mutex_unlock(&MUTEX.mtx_buf);
-        // Write response back to jobCommander
-        if (write(sock, "JOB <", 5) == -1) perrorexit("write");
-        if (write(sock, job->id, strlen(job->id)) == -1) perrorexit("write");
-        if (write(sock, ", ", 2) == -1) perrorexit("write");
-        fullwrite(sock, job->full_command, strlen(job->full_command));
-        if (write(sock, "> SUBMITTED\n", 12) == -1) perrorexit("write");
-        // Perhaps a job should wakeup (cond is checked in worker-thread)
-        pthread_cond_signal(&CONDVAR.wakeup_job);
+        free(record);
+        ring_destroy(ring);
+        conn_release(conn);
         break;
     default:
         errorexit("Invalid command");
@@ -197,7 +535,10 @@ static void *thread_controller(void *arg) {
 
 // Implementation of worker threads
 static void *thread_worker(void *arg) {
-    (void)arg;
+    int index = *(int *)arg;
+    free(arg);
+    pin_worker(index);
+    char *frame = transport_frame_create(); // Reused for every output this worker compresses
     while (!DATA.exit_program) {
         pthread_mutex_lock(&MUTEX.mtx_active_workers);
         pthread_mutex_lock(&MUTEX.mtx_concurrency);
@@ -211,6 +552,7 @@ static void *thread_worker(void *arg) {
             pthread_cond_wait(&CONDVAR.wakeup_job, &MUTEX.mtx_active_workers);
             if (DATA.exit_program) {
                 pthread_mutex_unlock(&MUTEX.mtx_active_workers);
+                free(frame);
                 pthread_exit(NULL);
             }
             pthread_mutex_lock(&MUTEX.mtx_concurrency);
@@ -223,6 +565,7 @@ static void *thread_worker(void *arg) {
         pthread_mutex_unlock(&MUTEX.mtx_active_workers);
 
         pthread_cond_signal(&CONDVAR.buf_not_full); // Just removed a job from buf
+        int node_index = place_job(job);
 
         // Tokenize command in order to execute it
         char **argv = malloc((job->argc + 1) * sizeof(*argv));
@@ -240,6 +583,8 @@ static void *thread_worker(void *arg) {
         pid_t pid;
         struct stat st;
         char *resp;
+        size_t chunk;
+        TransportStats stats = {0};
         switch (pid = fork()) {
         case -1:
             perrorexit("fork");
@@ -250,27 +595,40 @@ static void *thread_worker(void *arg) {
             if ((fd = open(buf, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) perrorexit("open");
             if (dup2(fd, STDOUT_FILENO) == -1) perrorexit("dup2");
             if (close(fd) == -1) perrorexit("close");
+            // Run job on its node/CPUs (if any)
+            placement_apply(DATA.topo, &job->placement);
             // Execute job
             execvp(argv[0], argv);
             perrorexit("execvp");
             break;
         default:
             if (waitpid(pid, NULL, 0) != pid) perrorexit("waitpid");
-            // Read program's output
             sprintf(buf, "%d.output", pid);
             if ((fd = open(buf, O_RDONLY)) == -1) perrorexit("open");
             if (fstat(fd, &st) == -1) perrorexit("fstat");
-            if ((resp = malloc(st.st_size * sizeof(*resp))) == NULL) perrorexit("malloc");
-            fullread(fd, resp, st.st_size);
-            if (close(fd) == -1) perrorexit("read");
-            // Write response
+            // Jobs sharing a connection must not interleave their outputs
+            wait_job_acked(job);
+            lock_job_conn(job);
             sprintf(buf, "----- %s output start ------\n\n", job->id);
-            if (write(job->sock, buf, strlen(buf)) == -1) perrorexit("write");
-            fullwrite(job->sock, resp, st.st_size);
-            sprintf(buf, "\n------ %s output end -------\n", job->id);
-            if (write(job->sock, buf, strlen(buf)) == -1) perrorexit("write");
-            if (shutdown(job->sock, SHUT_WR) == -1) perrorexit("shutdown");
+            send_to_job(job, buf, strlen(buf));
+            // Send program's output in bounded chunks, so that memory use does not grow with its size
+            if ((resp = malloc(CHUNK_SIZE * sizeof(*resp))) == NULL) perrorexit("malloc");
+            // Nothing more is read once the client has gone away
+            bool alive = true;
+            for (off_t sent = 0; alive && sent < st.st_size; sent += chunk) {
+                chunk = st.st_size - sent < CHUNK_SIZE ? st.st_size - sent : CHUNK_SIZE;
+                if (!fullread(fd, resp, chunk)) errorexit("read: unexpected EOF");
+                alive = transport_send(job->sock, job->codecs, resp, chunk, frame, &stats);
+            }
             free(resp);
+            if (close(fd) == -1) perrorexit("close");
+            sprintf(buf, "\n------ %s output end -------\n", job->id);
+            send_to_job(job, buf, strlen(buf));
+            unlock_job_conn(job);
+            finish_job_conn(job);
+            pthread_mutex_lock(&MUTEX.mtx_stats);
+            transport_stats_merge(&DATA.output_stats, &stats);
+            pthread_mutex_unlock(&MUTEX.mtx_stats);
             break;
         }
         free(cmd_copy);
@@ -278,37 +636,55 @@ static void *thread_worker(void *arg) {
         sprintf(buf, "%d.output", pid);
         if (unlink(buf) == -1) perrorexit("unlink");
         job_destroy(job);
+        unplace_job(node_index);
         pthread_mutex_lock(&MUTEX.mtx_active_workers);
         DATA.active_workers--;
         pthread_mutex_unlock(&MUTEX.mtx_active_workers);
     }
+    free(frame);
     pthread_exit(NULL);
 }
 
 int main(int argc, char **argv) {
     // Assure that program arguments are valid
     uint16_t port;
-    parse_args(argc, argv, &port, &DATA.capacity, &DATA.thread_pool_size);
+    parse_args(argc, argv, &port, &DATA.capacity, &DATA.thread_pool_size, &DATA.pin_mode);
 
     DATA.buf = queue_create();
     DATA.jobid_counter = 1;
     DATA.concurrency = 1;
     DATA.active_workers = 0;
     DATA.exit_program = false;
+    DATA.topo = topology_detect();
+    // Clients may go away at any time: writing to them must fail (EPIPE) rather than kill the server
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) perrorexit("signal");
+    if ((DATA.node_running = calloc(DATA.topo->num_nodes, sizeof(*DATA.node_running))) == NULL)
+        perrorexit("calloc");
+    if ((DATA.node_dispatched = calloc(DATA.topo->num_nodes, sizeof(*DATA.node_dispatched))) == NULL)
+        perrorexit("calloc");
+    DATA.unplaced_running = 0;
     // Init mutexes
     if (pthread_mutex_init(&MUTEX.mtx_buf, NULL) != 0) errorexit("pthread_mutex_init");
     if (pthread_mutex_init(&MUTEX.mtx_active_workers, NULL) != 0) errorexit("pthread_mutex_init");
     if (pthread_mutex_init(&MUTEX.mtx_concurrency, NULL) != 0) errorexit("pthread_mutex_init");
     if (pthread_mutex_init(&MUTEX.mtx_jobid, NULL) != 0) errorexit("pthread_mutex_init");
+    if (pthread_mutex_init(&MUTEX.mtx_nodes, NULL) != 0) errorexit("pthread_mutex_init");
+    if (pthread_mutex_init(&MUTEX.mtx_stats, NULL) != 0) errorexit("pthread_mutex_init");
+    if (pthread_mutex_init(&MUTEX.mtx_acked, NULL) != 0) errorexit("pthread_mutex_init");
     // Init conditional variables
     if (pthread_cond_init(&CONDVAR.wakeup_job, NULL) != 0) errorexit("pthread_cond_init");
     if (pthread_cond_init(&CONDVAR.buf_not_full, NULL) != 0) errorexit("pthread_cond_init");
+    if (pthread_cond_init(&CONDVAR.job_acked, NULL) != 0) errorexit("pthread_cond_init");
     // Initiate worker threads
     if ((DATA.worker_threads = malloc(DATA.thread_pool_size * sizeof(*DATA.worker_threads))) == NULL)
         perrorexit("malloc");
-    for (int i = 0; i < DATA.thread_pool_size; i++)
-        if (pthread_create(&DATA.worker_threads[i], NULL, thread_worker, NULL) != 0)
+    int *worker_index;
+    for (int i = 0; i < DATA.thread_pool_size; i++) {
+        if ((worker_index = malloc(sizeof(*worker_index))) == NULL) perrorexit("malloc");
+        *worker_index = i;
+        if (pthread_create(&DATA.worker_threads[i], NULL, thread_worker, worker_index) != 0)
             errorexit("pthread_create");
+    }
 
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd == -1) perrorexit("socket");
@@ -319,15 +695,27 @@ int main(int argc, char **argv) {
     if (bind(sockfd, (struct sockaddr *)&server, sizeof(server)) == -1) perrorexit("bind");
     if (listen(sockfd, 12) == -1) perrorexit("listen");
     printf("Listening for connections to port %d\n", port);
+    // Local clients skip the TCP stack through a unix domain socket (if possible, TCP is enough otherwise)
+    int local_sockfd = listen_local(port);
+    if (local_sockfd != -1) printf("Listening for local connections at %s\n", DATA.local_path);
+    struct pollfd listeners[2] = {{.fd = sockfd, .events = POLLIN}, {.fd = local_sockfd, .events = POLLIN}};
+    int num_listeners = local_sockfd != -1 ? 2 : 1;
     pthread_t p;
     int *newsock, tmp;
     while (!DATA.exit_program) {
-        if ((tmp = accept(sockfd, NULL, NULL)) == -1) perrorexit("accept");
-        printf("Accepted connection\n");
-        if ((newsock = malloc(sizeof(*newsock))) == NULL) perrorexit("malloc");
-        *newsock = tmp;
-        if (pthread_create(&p, NULL, thread_controller, newsock) != 0) errorexit("pthread_create");
-        if (pthread_detach(p) != 0) errorexit("pthread_detach");
+        if (poll(listeners, num_listeners, -1) == -1) {
+            if (errno == EINTR) continue;
+            perrorexit("poll");
+        }
+        for (int i = 0; i < num_listeners; i++) {
+            if (!(listeners[i].revents & POLLIN)) continue;
+            if ((tmp = accept(listeners[i].fd, NULL, NULL)) == -1) perrorexit("accept");
+            printf("Accepted connection\n");
+            if ((newsock = malloc(sizeof(*newsock))) == NULL) perrorexit("malloc");
+            *newsock = tmp;
+            if (pthread_create(&p, NULL, thread_controller, newsock) != 0) errorexit("pthread_create");
+            if (pthread_detach(p) != 0) errorexit("pthread_detach");
+        }
     }
     pthread_exit(NULL);
-}
\ No newline at end of file
+}
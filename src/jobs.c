@@ -2,7 +2,8 @@
 
 #include "jobs.h"
 
-Job *job_create(char *id, char *full_command, int argc, Command command, int sock) {
+Job *job_create(char *id, char *full_command, int argc, Command command, int sock, Placement *placement,
+                int codecs) {
     Job *job = malloc(sizeof(*job));
     if (job == NULL) perrorexit("malloc");
     job->id = duplicate_str(id);
@@ -10,6 +11,15 @@ Job *job_create(char *id, char *full_command, int argc, Command command, int soc
     job->argc = argc;
     job->command = command;
     job->sock = sock;
+    if (placement != NULL) {
+        job->placement = *placement;
+    } else {
+        job->placement.node = -1;
+        job->placement.has_cpus = false;
+    }
+    job->codecs = codecs;
+    job->conn = NULL;
+    job->acked = false;
     return job;
 }
 
@@ -0,0 +1,126 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ring.h"
+#include "utils.h"
+
+Ring *ring_create(void) {
+    Ring *ring = malloc(sizeof(*ring));
+    if (ring == NULL) perrorexit("malloc");
+    if ((ring->memfd = memfd_create("jobring", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1) perrorexit("memfd_create");
+    if (ftruncate(ring->memfd, sizeof(RingShm)) == -1) perrorexit("ftruncate");
+    // The server only maps memory that can no longer shrink under it (which would make it SIGBUS)
+    if (fcntl(ring->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) perrorexit("fcntl");
+    ring->shm = mmap(NULL, sizeof(RingShm), PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+    if (ring->shm == MAP_FAILED) perrorexit("mmap");
+    // A fresh memfd is zero-filled, so head, tail and the waiting flags already start at 0
+    if ((ring->data_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) perrorexit("eventfd");
+    if ((ring->space_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) perrorexit("eventfd");
+    return ring;
+}
+
+// Returns true only if given fd is a non-blocking eventfd open for both reading and writing
+static bool valid_eventfd(int fd) {
+    char path[64], link[64];
+    ssize_t n;
+    sprintf(path, "/proc/self/fd/%d", fd);
+    if ((n = readlink(path, link, sizeof(link) - 1)) == -1) return false;
+    link[n] = '\0';
+    int flags = fcntl(fd, F_GETFL);
+    return strcmp(link, "anon_inode:[eventfd]") == 0 && flags != -1 &&
+           (flags & O_ACCMODE) == O_RDWR && (flags & O_NONBLOCK);
+}
+
+Ring *ring_attach(int memfd, int data_efd, int space_efd) {
+    struct stat st;
+    int required = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+    int seals = fcntl(memfd, F_GET_SEALS); // Fails for anything but a memfd
+    if (seals == -1 || (seals & required) != required) return NULL;
+    if (fstat(memfd, &st) == -1 || st.st_size != sizeof(RingShm)) return NULL;
+    if (!valid_eventfd(data_efd) || !valid_eventfd(space_efd)) return NULL;
+    // Fails if memfd was opened read-only or sealed against writing
+    void *shm = mmap(NULL, sizeof(RingShm), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (shm == MAP_FAILED) return NULL;
+    Ring *ring = malloc(sizeof(*ring));
+    if (ring == NULL) perrorexit("malloc");
+    ring->memfd = memfd;
+    ring->data_efd = data_efd;
+    ring->space_efd = space_efd;
+    ring->shm = shm;
+    return ring;
+}
+
+void ring_destroy(Ring *ring) {
+    if (ring == NULL) return;
+    if (munmap(ring->shm, sizeof(RingShm)) == -1) perrorexit("munmap");
+    if (close(ring->memfd) == -1) perrorexit("close");
+    if (close(ring->data_efd) == -1) perrorexit("close");
+    if (close(ring->space_efd) == -1) perrorexit("close");
+    free(ring);
+}
+
+/* Writes to given eventfd in order to wake up whoever sleeps on it. Returns false on failure.
+   A saturated counter (EAGAIN) means a wakeup is already pending, so it is not a failure */
+static bool wakeup(int efd) {
+    uint64_t one = 1;
+    return write(efd, &one, sizeof(one)) != -1 || errno == EAGAIN;
+}
+
+/* Sleeps until efd is written or peer_sock is hung up. Returns false in the latter case or if efd fails.
+   The caller must have announced that it sleeps and re-checked the ring before calling this */
+static bool sleep_on(int efd, int peer_sock) {
+    struct pollfd fds[2] = {{.fd = efd, .events = POLLIN}, {.fd = peer_sock, .events = POLLRDHUP}};
+    uint64_t count;
+    while (poll(fds, 2, -1) == -1)
+        if (errno != EINTR) perrorexit("poll");
+    if (fds[0].revents & POLLIN) // The other side may have drained it first (EAGAIN)
+        return read(efd, &count, sizeof(count)) != -1 || errno == EAGAIN;
+    return false;
+}
+
+bool ring_push(Ring *ring, void *record, size_t len, int peer_sock) {
+    RingShm *shm = ring->shm;
+    uint32_t head = atomic_load(&shm->head);
+    while (head - atomic_load(&shm->tail) == RING_SLOTS) { // Full
+        atomic_store(&shm->producer_waiting, true);
+        // The consumer may have made room before it could see the flag
+        bool full = head - atomic_load(&shm->tail) == RING_SLOTS;
+        bool alive = !full || sleep_on(ring->space_efd, peer_sock);
+        atomic_store(&shm->producer_waiting, false);
+        if (!alive && head - atomic_load(&shm->tail) == RING_SLOTS) return false;
+    }
+    RingSlot *slot = &shm->slots[head % RING_SLOTS];
+    slot->len = len;
+    memcpy(slot->data, record, len);
+    atomic_store(&shm->head, head + 1); // Publish the record
+    return !atomic_load(&shm->consumer_waiting) || wakeup(ring->data_efd);
+}
+
+int ring_pop(Ring *ring, void *buf, int peer_sock) {
+    RingShm *shm = ring->shm;
+    uint32_t tail = atomic_load(&shm->tail);
+    while (atomic_load(&shm->head) == tail) { // Empty
+        atomic_store(&shm->consumer_waiting, true);
+        // The producer may have published a record before it could see the flag
+        bool empty = atomic_load(&shm->head) == tail;
+        bool alive = !empty || sleep_on(ring->data_efd, peer_sock);
+        atomic_store(&shm->consumer_waiting, false);
+        if (!alive && atomic_load(&shm->head) == tail) return -1;
+    }
+    RingSlot *slot = &shm->slots[tail % RING_SLOTS];
+    // The producer is not trusted to respect the slot size (nor to leave len alone while it is checked)
+    uint32_t len = *(volatile uint32_t *)&slot->len;
+    if (len > RING_RECORD_SIZE) len = RING_RECORD_SIZE;
+    memcpy(buf, slot->data, len);
+    atomic_store(&shm->tail, tail + 1); // Free the slot
+    if (atomic_load(&shm->producer_waiting) && !wakeup(ring->space_efd)) return -1;
+    return len;
+}
@@ -0,0 +1,175 @@
+#include <dirent.h>
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "topology.h"
+#include "utils.h"
+
+#define NODE_DIR "/sys/devices/system/node"
+#define MAX_NODES 1024 // Largest node ID (exclusive) that memory can be bound to
+
+static int cmp_nodes(const void *a, const void *b) {
+    return ((NumaNode *)a)->id - ((NumaNode *)b)->id;
+}
+
+// Reads the cpulist file of node with given ID into given set. Returns false on failure
+static bool read_node_cpus(int node_id, cpu_set_t *set) {
+    char path[256], buf[4096];
+    sprintf(path, NODE_DIR "/node%d/cpulist", node_id);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return false;
+    bool ok = fgets(buf, sizeof(buf), fp) != NULL;
+    if (fclose(fp) == EOF) perrorexit("fclose");
+    if (!ok) return false;
+    buf[strcspn(buf, "\n")] = '\0';
+    return parse_cpulist(buf, set);
+}
+
+Topology *topology_detect(void) {
+    Topology *topo = calloc(1, sizeof(*topo));
+    if (topo == NULL) perrorexit("calloc");
+    // CPUs we may run on (e.g. restricted by a cpuset cgroup or taskset)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == -1) perrorexit("sched_getaffinity");
+
+    DIR *dir = opendir(NODE_DIR);
+    if (dir != NULL) {
+        int capacity = 0, id;
+        struct dirent *entry;
+        cpu_set_t cpus;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "node", 4) != 0 || entry->d_name[4] == '\0' ||
+                !only_numeric_digits(entry->d_name + 4))
+                continue;
+            id = atoi(entry->d_name + 4);
+            // Memory-only nodes (and nodes whose CPUs are all off-limits to us) cannot run jobs
+            if (!read_node_cpus(id, &cpus)) continue;
+            CPU_AND(&cpus, &cpus, &allowed);
+            if (CPU_COUNT(&cpus) == 0) continue;
+            if (topo->num_nodes == capacity) {
+                capacity = capacity == 0 ? 4 : 2 * capacity;
+                topo->nodes = realloc(topo->nodes, capacity * sizeof(*topo->nodes));
+                if (topo->nodes == NULL) perrorexit("realloc");
+            }
+            topo->nodes[topo->num_nodes].id = id;
+            topo->nodes[topo->num_nodes].cpus = cpus;
+            topo->nodes[topo->num_nodes].ncpus = CPU_COUNT(&cpus);
+            topo->num_nodes++;
+        }
+        if (closedir(dir) == -1) perrorexit("closedir");
+    }
+
+    if (topo->num_nodes > 0) {
+        topo->numa = true;
+        qsort(topo->nodes, topo->num_nodes, sizeof(*topo->nodes), cmp_nodes);
+    } else { // No NUMA info: every CPU we may run on is part of node 0
+        if ((topo->nodes = malloc(sizeof(*topo->nodes))) == NULL) perrorexit("malloc");
+        topo->nodes[0].id = 0;
+        topo->nodes[0].cpus = allowed;
+        topo->nodes[0].ncpus = CPU_COUNT(&topo->nodes[0].cpus);
+        topo->num_nodes = 1;
+        topo->numa = false;
+    }
+    return topo;
+}
+
+void topology_destroy(Topology *topo) {
+    if (topo == NULL) return;
+    if (topo->nodes != NULL) free(topo->nodes);
+    free(topo);
+}
+
+int topology_node_index(Topology *topo, int node_id) {
+    for (int i = 0; i < topo->num_nodes; i++)
+        if (topo->nodes[i].id == node_id) return i;
+    return -1;
+}
+
+int topology_cpu_node(Topology *topo, int cpu) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return -1;
+    for (int i = 0; i < topo->num_nodes; i++)
+        if (CPU_ISSET(cpu, &topo->nodes[i].cpus)) return i;
+    return -1;
+}
+
+int cpuset_nth(cpu_set_t *set, int n) {
+    int count = CPU_COUNT(set);
+    if (count == 0) return -1;
+    n %= count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, set) && n-- == 0) return cpu;
+    return -1;
+}
+
+bool parse_cpulist(const char *str, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = str;
+    char *end;
+    long first, last;
+    while (*p != '\0') {
+        if (*p < '0' || *p > '9') return false;
+        first = last = strtol(p, &end, 10);
+        p = end;
+        if (*p == '-') {
+            p++;
+            if (*p < '0' || *p > '9') return false;
+            last = strtol(p, &end, 10);
+            p = end;
+        }
+        if (first > last || last >= CPU_SETSIZE) return false;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        if (*p == ',') p++;
+        else if (*p != '\0') return false;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+void format_cpulist(cpu_set_t *set, char *buf, size_t size) {
+    size_t len = 0;
+    int n;
+    buf[0] = '\0';
+    for (int cpu = 0; cpu < CPU_SETSIZE && len < size; cpu++) {
+        if (!CPU_ISSET(cpu, set)) continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) last++;
+        if (last == cpu) n = snprintf(buf + len, size - len, "%s%d", len > 0 ? "," : "", cpu);
+        else n = snprintf(buf + len, size - len, "%s%d-%d", len > 0 ? "," : "", cpu, last);
+        if (n < 0) return;
+        len += n;
+        cpu = last;
+    }
+}
+
+bool placement_valid(Topology *topo, Placement *placement) {
+    if (placement->node != -1 && topology_node_index(topo, placement->node) == -1) return false;
+    if (placement->has_cpus) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &placement->cpus) && topology_cpu_node(topo, cpu) == -1) return false;
+    }
+    return true;
+}
+
+void placement_apply(Topology *topo, Placement *placement) {
+    int index = placement->node == -1 ? -1 : topology_node_index(topo, placement->node);
+    if (placement->has_cpus) {
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &placement->cpus) == -1) perrorexit("sched_setaffinity");
+    } else if (index != -1) {
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &topo->nodes[index].cpus) == -1)
+            perrorexit("sched_setaffinity");
+    }
+    // Without NUMA support there is only one memory node, so there is nothing to bind to
+    if (index == -1 || !topo->numa) return;
+    unsigned long nodemask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    size_t bits = 8 * sizeof(unsigned long);
+    if (placement->node >= MAX_NODES) errorexit("set_mempolicy: node ID too large");
+    nodemask[placement->node / bits] |= 1UL << (placement->node % bits);
+    // Called between fork() and execvp(), so the mask lives on the stack instead of the heap
+    if (syscall(SYS_set_mempolicy, MPOL_BIND, nodemask, MAX_NODES + 1) == -1 && errno != ENOSYS)
+        perrorexit("set_mempolicy");
+}
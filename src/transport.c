@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "transport.h"
+#include "utils.h"
+
+#define HEADER_SIZE (sizeof(uint8_t) + 2 * sizeof(uint32_t))
+
+// Returns the CPU time consumed by the calling thread in seconds
+static double thread_cpu_time(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1) perrorexit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Writes a frame header into buf
+static void put_header(char *buf, uint8_t codec, uint32_t raw_len, uint32_t payload_len) {
+    memcpy(buf, &codec, sizeof(uint8_t));
+    memcpy(buf + sizeof(uint8_t), &raw_len, sizeof(uint32_t));
+    memcpy(buf + sizeof(uint8_t) + sizeof(uint32_t), &payload_len, sizeof(uint32_t));
+}
+
+/* Writes all iovcnt buffers of iov to fd, like fullwrite() does for a single one.
+   Returns false if fd's peer has gone away */
+static bool fullwritev(int fd, struct iovec *iov, int iovcnt) {
+    ssize_t cbw; // Current number of bytes written
+    while (iovcnt > 0) {
+        if ((cbw = writev(fd, iov, iovcnt)) == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EPIPE || errno == ECONNRESET) return false;
+            perrorexit("writev");
+        }
+        // Skip what was written, resuming from the middle of a buffer if needed
+        while (iovcnt > 0 && (size_t)cbw >= iov->iov_len) {
+            cbw -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + cbw;
+            iov->iov_len -= cbw;
+        }
+    }
+    return true;
+}
+
+char *transport_frame_create(void) {
+    char *frame = malloc(HEADER_SIZE + compressBound(CHUNK_SIZE));
+    if (frame == NULL) perrorexit("malloc");
+    return frame;
+}
+
+bool transport_send(int fd, int codecs, void *buf, size_t count, char *frame, TransportStats *stats) {
+    TransportStats local = {0};
+    bool alive;
+    if (codecs == 0) {
+        struct iovec iov = {.iov_base = buf, .iov_len = count};
+        if ((alive = fullwritev(fd, &iov, 1))) local.raw_bytes = local.wire_bytes = count;
+        if (stats != NULL) transport_stats_merge(stats, &local);
+        return alive;
+    }
+
+    Codec codec = (codecs & CODEC_MASK(CODEC_ZLIB)) ? CODEC_ZLIB : CODEC_NONE;
+    char *own_frame = NULL; // Allocated here if the caller gave no frame
+    char *data = buf;
+    char header[HEADER_SIZE];
+    size_t raw_len;
+    uLongf payload_len;
+    double start;
+    alive = true;
+    for (size_t offset = 0; offset < count; offset += raw_len) {
+        raw_len = count - offset < CHUNK_SIZE ? count - offset : CHUNK_SIZE;
+        payload_len = compressBound(raw_len);
+        bool compressed = false;
+        if (codec == CODEC_ZLIB && raw_len >= MIN_COMPRESS_SIZE) {
+            if (frame == NULL) frame = own_frame = transport_frame_create();
+            start = thread_cpu_time();
+            // Fastest level: the point is to relieve the link, not to burn the server's CPU
+            compressed = compress2((Bytef *)frame + HEADER_SIZE, &payload_len, (Bytef *)data + offset,
+                                   raw_len, Z_BEST_SPEED) == Z_OK && payload_len < raw_len;
+            local.cpu_seconds += thread_cpu_time() - start;
+        }
+        if (compressed) {
+            put_header(frame, CODEC_ZLIB, raw_len, payload_len);
+            struct iovec iov = {.iov_base = frame, .iov_len = HEADER_SIZE + payload_len};
+            if (!(alive = fullwritev(fd, &iov, 1))) break;
+            local.compressed_chunks++;
+        } else { // Small or incompressible chunk: sent straight from buf, without copying it
+            payload_len = raw_len;
+            put_header(header, CODEC_NONE, raw_len, payload_len);
+            struct iovec iov[2] = {{.iov_base = header, .iov_len = HEADER_SIZE},
+                                   {.iov_base = data + offset, .iov_len = raw_len}};
+            if (!(alive = fullwritev(fd, iov, 2))) break;
+            local.stored_chunks++;
+        }
+        local.raw_bytes += raw_len;
+        local.wire_bytes += HEADER_SIZE + payload_len;
+    }
+    if (own_frame != NULL) free(own_frame);
+    if (stats != NULL) transport_stats_merge(stats, &local);
+    return alive;
+}
+
+void transport_recv(int fd, int out_fd) {
+    char header[HEADER_SIZE];
+    char *payload = malloc(compressBound(CHUNK_SIZE));
+    char *raw = malloc(CHUNK_SIZE);
+    if (payload == NULL || raw == NULL) perrorexit("malloc");
+    uint8_t codec;
+    uint32_t raw_len, payload_len;
+    uLongf dest_len;
+    ssize_t n;
+    while (true) {
+        // EOF is only legit between frames
+        if ((n = read(fd, header, 1)) == -1) perrorexit("read");
+        if (n == 0) break;
+        if (!fullread(fd, header + 1, HEADER_SIZE - 1)) errorexit("read: unexpected EOF");
+        memcpy(&codec, header, sizeof(uint8_t));
+        memcpy(&raw_len, header + sizeof(uint8_t), sizeof(uint32_t));
+        memcpy(&payload_len, header + sizeof(uint8_t) + sizeof(uint32_t), sizeof(uint32_t));
+        if (raw_len > CHUNK_SIZE || payload_len > compressBound(CHUNK_SIZE)) errorexit("Invalid frame");
+        if (!fullread(fd, payload, payload_len)) errorexit("read: unexpected EOF");
+        switch (codec) {
+        case CODEC_NONE:
+            if (payload_len != raw_len) errorexit("Invalid frame");
+            fullwrite(out_fd, payload, raw_len);
+            break;
+        case CODEC_ZLIB:
+            dest_len = raw_len;
+            if (uncompress((Bytef *)raw, &dest_len, (Bytef *)payload, payload_len) != Z_OK || dest_len != raw_len)
+                errorexit("uncompress");
+            fullwrite(out_fd, raw, raw_len);
+            break;
+        default:
+            errorexit("Invalid frame codec");
+            break;
+        }
+    }
+    free(payload);
+    free(raw);
+}
+
+void transport_stats_merge(TransportStats *dst, TransportStats *src) {
+    dst->raw_bytes += src->raw_bytes;
+    dst->wire_bytes += src->wire_bytes;
+    dst->compressed_chunks += src->compressed_chunks;
+    dst->stored_chunks += src->stored_chunks;
+    dst->cpu_seconds += src->cpu_seconds;
+}
@@ -2,8 +2,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "commands.h"
 #include "utils.h"
 
 void perrorexit(char *s) {
@@ -31,16 +34,19 @@ bool only_numeric_digits(char *str) {
     return true;
 }
 
-void fullread(int fd, void *buf, size_t count) {
+bool fullread(int fd, void *buf, size_t count) {
     ssize_t cbr; // Current number of bytes read
     size_t tbr = 0; // Total number of bytes read
     while (tbr < count) {
         if ((cbr = read(fd, (char *)buf + tbr, count - tbr)) == -1) {
             if (errno == EINTR) continue;
+            if (errno == ECONNRESET) return false; // A socket's peer went away: no different from EOF
             perrorexit("read");
         }
+        if (cbr == 0) return false;
         tbr += cbr;
     }
+    return true;
 }
 
 void fullwrite(int fd, void *buf, size_t count) {
@@ -53,4 +59,67 @@ void fullwrite(int fd, void *buf, size_t count) {
         }
         tbw += cbw;
     }
-}
\ No newline at end of file
+}
+
+void send_fds(int sock, int *fds, int count) {
+    char dummy = 0;
+    struct iovec iov = {.iov_base = &dummy, .iov_len = 1};
+    char *control = calloc(1, CMSG_SPACE(count * sizeof(int)));
+    if (control == NULL) perrorexit("calloc");
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1,
+                         .msg_control = control, .msg_controllen = CMSG_SPACE(count * sizeof(int))};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+    while (sendmsg(sock, &msg, 0) == -1)
+        if (errno != EINTR) perrorexit("sendmsg");
+    free(control);
+}
+
+bool recv_fds(int sock, int *fds, int count) {
+    char dummy;
+    struct iovec iov = {.iov_base = &dummy, .iov_len = 1};
+    char *control = calloc(1, CMSG_SPACE(count * sizeof(int)));
+    if (control == NULL) perrorexit("calloc");
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1,
+                         .msg_control = control, .msg_controllen = CMSG_SPACE(count * sizeof(int))};
+    ssize_t n;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1)
+        if (errno != EINTR) perrorexit("recvmsg");
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    bool ok = n == 1 && !(msg.msg_flags & MSG_CTRUNC) && cmsg != NULL &&
+              cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+              cmsg->cmsg_len == CMSG_LEN(count * sizeof(int));
+    if (ok) {
+        memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+    } else if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        // Do not leak whatever (wrong number of) descriptors did arrive
+        int received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *received_fds = (int *)CMSG_DATA(cmsg);
+        for (int i = 0; i < received; i++)
+            if (close(received_fds[i]) == -1) perrorexit("close");
+    }
+    free(control);
+    return ok;
+}
+
+char *local_socket_path(uint16_t port, bool create, char *buf, size_t size) {
+    char dir[256];
+    char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir != NULL && runtime_dir[0] != '\0') {
+        if (snprintf(dir, sizeof(dir), "%s", runtime_dir) >= (int)sizeof(dir)) return "path is too long";
+    } else {
+        sprintf(dir, LOCAL_SOCKET_DIR, (unsigned)getuid());
+        if (create && mkdir(dir, 0700) == -1 && errno != EEXIST) return "its directory cannot be created";
+    }
+    // lstat() so that a symlink planted by someone else is not followed
+    struct stat st;
+    if (lstat(dir, &st) == -1) return "its directory does not exist";
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077))
+        return "its directory is not private to this user";
+    int len = snprintf(buf, size, "%s/" LOCAL_SOCKET_NAME, dir, port);
+    if (len < 0 || (size_t)len >= size) return "path is too long";
+    return NULL;
+}
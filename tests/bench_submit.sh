@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Compares the submission latency of the TCP loopback, unix domain socket and shared-memory ring paths.
+# submitLatency.c times each job from its submission until the server acknowledges it (SUBMITTED), one job
+# at a time, so no process start-up is involved. The ring is also timed in bulk (all jobs pushed at once).
+# Execution is paused meanwhile, by a server whose single worker is kept busy by a job that blocks on a
+# fifo, so that running jobs do not skew the numbers. The server is started on given port (default 21180).
+
+PORT=${1:-21180}
+JOBS=${2:-200}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+gcc -O2 -D_GNU_SOURCE -Iinclude tests/submitLatency.c src/utils.c src/ring.c -o "$TMP/submitLatency" -lpthread || exit 1
+
+# Every job stays queued: TCP, unix and two rounds through the ring
+mkfifo "$TMP/gate"
+./bin/jobExecutorServer $PORT $((4 * JOBS + 1)) 1 > /dev/null &
+sleep 0.5
+# Occupy the only worker until the gate opens
+./bin/jobCommander 127.0.0.1 $PORT issueJob cat "$TMP/gate" > "$TMP/blocker" &
+until grep -q SUBMITTED "$TMP/blocker"; do sleep 0.05; done
+
+"$TMP/submitLatency" tcp $PORT $JOBS
+"$TMP/submitLatency" unix $PORT $JOBS
+"$TMP/submitLatency" ring $PORT $JOBS
+
+# Open the gate and terminate the server (queued jobs are dropped)
+echo > "$TMP/gate"
+./bin/jobCommander 127.0.0.1 $PORT exit > /dev/null
+wait
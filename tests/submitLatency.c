@@ -0,0 +1,144 @@
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "commands.h"
+#include "ring.h"
+#include "utils.h"
+
+// Measures how long the server takes to acknowledge (SUBMITTED) jobs, without any process start-up involved
+
+#define JOB "true"
+#define ACK "SUBMITTED\n"
+
+static double now_us(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) perrorexit("clock_gettime");
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Builds an ISSUE_JOB message for JOB (no hints, no compression) into msg and returns its length
+static int issue_job_msg(char *msg) {
+    int values[4] = {ISSUE_JOB, 0, 1, sizeof(JOB)}; // command, codecs, num_of_args, bytes_to_read
+    int hints[2] = {-1, 0}; // node, cpus_len
+    memcpy(msg, values, sizeof(values));
+    memcpy(msg + sizeof(values), JOB, sizeof(JOB));
+    memcpy(msg + sizeof(values) + sizeof(JOB), hints, sizeof(hints));
+    return sizeof(values) + sizeof(JOB) + sizeof(hints);
+}
+
+// Reads from sock until count more acks have arrived. *matched carries a partially read ack across calls
+static void wait_acks(int sock, int count, size_t *matched) {
+    char buf[4096];
+    ssize_t n;
+    while (count > 0) {
+        if ((n = read(sock, buf, sizeof(buf))) <= 0) errorexit("Server hung up before acknowledging");
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != ACK[*matched]) *matched = 0;
+            if (buf[i] == ACK[*matched] && ++*matched == strlen(ACK)) {
+                *matched = 0;
+                count--;
+            }
+        }
+    }
+}
+
+typedef struct {
+    int sock;
+    int count;
+    size_t *matched;
+} AckWaiter;
+
+// wait_acks() for a thread: the server stops consuming the ring if its acks are not read meanwhile
+static void *thread_wait_acks(void *arg) {
+    AckWaiter *waiter = arg;
+    wait_acks(waiter->sock, waiter->count, waiter->matched);
+    return NULL;
+}
+
+static int connect_to(int local, uint16_t port) {
+    int sock;
+    if (local) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (local_socket_path(port, false, addr.sun_path, sizeof(addr.sun_path)) != NULL)
+            errorexit("No local socket");
+        if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) perrorexit("socket");
+        if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) perrorexit("connect");
+    } else {
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port),
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+        if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) perrorexit("socket");
+        if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) perrorexit("connect");
+    }
+    return sock;
+}
+
+// One connection per job, as jobCommander's issueJob does: connect, submit, wait for the ack, repeat
+static void bench_per_job(int local, uint16_t port, int jobs) {
+    char msg[64];
+    int len = issue_job_msg(msg);
+    size_t matched;
+    double start = now_us();
+    for (int i = 0; i < jobs; i++) {
+        int sock = connect_to(local, port);
+        fullwrite(sock, msg, len);
+        matched = 0;
+        wait_acks(sock, 1, &matched);
+        if (close(sock) == -1) perrorexit("close");
+    }
+    printf("%s: %.1f us/job round trip (%d jobs)\n", local ? "Unix domain socket" : "TCP loopback      ",
+           (now_us() - start) / jobs, jobs);
+}
+
+// A single ring: first one record at a time (waiting for each ack), then all records at once
+static void bench_ring(uint16_t port, int jobs) {
+    char msg[64];
+    int len = issue_job_msg(msg);
+    int record_offset = 2 * sizeof(int); // Records leave the command and codecs out
+    int sock = connect_to(1, port);
+    int attach[2] = {ATTACH_RING, 0}; // command, codecs
+    fullwrite(sock, attach, sizeof(attach));
+    Ring *ring = ring_create();
+    int fds[3] = {ring->memfd, ring->data_efd, ring->space_efd};
+    send_fds(sock, fds, 3);
+
+    size_t matched = 0;
+    double start = now_us();
+    for (int i = 0; i < jobs; i++) {
+        if (!ring_push(ring, msg + record_offset, len - record_offset, sock)) errorexit("Server hung up");
+        wait_acks(sock, 1, &matched);
+    }
+    printf("Shared-memory ring: %.1f us/job round trip (%d jobs)\n", (now_us() - start) / jobs, jobs);
+
+    pthread_t waiter_thread;
+    AckWaiter waiter = {.sock = sock, .count = jobs, .matched = &matched};
+    start = now_us();
+    if (pthread_create(&waiter_thread, NULL, thread_wait_acks, &waiter) != 0) errorexit("pthread_create");
+    for (int i = 0; i < jobs; i++)
+        if (!ring_push(ring, msg + record_offset, len - record_offset, sock)) errorexit("Server hung up");
+    if (pthread_join(waiter_thread, NULL) != 0) errorexit("pthread_join");
+    printf("Shared-memory ring: %.1f us/job in bulk (%d jobs)\n", (now_us() - start) / jobs, jobs);
+
+    if (close(sock) == -1) perrorexit("close");
+    ring_destroy(ring);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4 || atoi(argv[2]) <= 0 || atoi(argv[3]) <= 0) {
+        printf("Usage: %s <tcp|unix|ring> <port> <jobs>\n", argv[0]);
+        return 1;
+    }
+    uint16_t port = atoi(argv[2]);
+    int jobs = atoi(argv[3]);
+    if (strcmp(argv[1], "tcp") == 0) bench_per_job(0, port, jobs);
+    else if (strcmp(argv[1], "unix") == 0) bench_per_job(1, port, jobs);
+    else if (strcmp(argv[1], "ring") == 0) bench_ring(port, jobs);
+    else errorexit("Unknown path");
+    return 0;
+}
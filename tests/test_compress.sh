@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Checks the compressed transport against the plain one: the same job must print the same output either way,
+# and status must report the chunks that were compressed. Expects a server running on given port (default 21180)
+
+PORT=${1:-21180}
+
+# Job IDs differ from one submission to the other
+run() {
+    ./bin/jobCommander localhost $PORT issueJob "$@" seq 1 200000 | sed 's/job_[0-9]*/job_X/g'
+}
+
+compressed_chunks() {
+    ./bin/jobCommander localhost $PORT status | sed -n 's/.*CHUNKS \([0-9]*\) COMPRESSED.*/\1/p'
+}
+
+before=$(compressed_chunks)
+plain=$(run)
+compressed=$(run --compress)
+after=$(compressed_chunks)
+
+status=0
+if [ -z "$plain" ] || [ "$plain" != "$compressed" ]; then
+    echo "FAILED: output differs with --compress"
+    status=1
+fi
+if [ -z "$before" ] || [ -z "$after" ] || [ "$after" -le "$before" ]; then
+    echo "FAILED: status reports no compressed chunks ($before before, $after after)"
+    status=1
+fi
+[ $status -eq 0 ] && echo "PASSED: compressed output matches ($((after - before)) chunks compressed)"
+exit $status
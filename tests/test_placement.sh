@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Checks placement hints: a missing node and a CPU outside the allowed ones must be rejected, while a job
+# hinted to node 0 must be counted as dispatched there. Expects a server running on given port (default 21180)
+
+PORT=${1:-21180}
+
+# One past the highest CPU ID of this machine, hence never allowed
+BAD_CPU=$(getconf _NPROCESSORS_CONF)
+
+dispatched_node0() {
+    ./bin/jobCommander localhost $PORT status | sed -n 's/^NODE 0 CPUS .*DISPATCHED \([0-9]*\),.*/\1/p'
+}
+
+status=0
+for hint in --node=9999 --cpus=$BAD_CPU; do
+    if ! ./bin/jobCommander localhost $PORT issueJob $hint true | grep -q "JOB REJECTED: INVALID PLACEMENT HINT"; then
+        echo "FAILED: $hint was not rejected"
+        status=1
+    fi
+done
+
+before=$(dispatched_node0)
+./bin/jobCommander localhost $PORT issueJob --node=0 true > /dev/null
+after=$(dispatched_node0)
+if [ -z "$before" ] || [ -z "$after" ] || [ "$after" -ne $((before + 1)) ]; then
+    echo "FAILED: --node=0 job not dispatched to node 0 ($before before, $after after)"
+    status=1
+fi
+[ $status -eq 0 ] && echo "PASSED: invalid hints rejected, node 0 job dispatched"
+exit $status